@@ -7,11 +7,22 @@
 */
 
 #include <stdio.h>      //  For user inputs, printf(), sprintf().
-#include <math.h>       //  For sin() and fmod().
+#include <math.h>       //  For sin(), fmod(), pow(), lrint() and isfinite().
 #include <stdbool.h>    //  For booleans.
 #include <string.h>     //  For strlen(), strcmp(), strtok().
 #include <limits.h>     //  For overflow checking.
 #include <stdlib.h>     //  For exit().
+#include <stdint.h>     //  For fixed width types in the compiled score format.
+#include <fcntl.h>      //  For open().
+#include <unistd.h>     //  For close() and alarm().
+#include <sys/mman.h>   //  For mmap().
+#include <sys/stat.h>   //  For fstat().
+#include <sys/socket.h> //  For the render server socket.
+#include <sys/un.h>     //  For Unix domain socket addresses.
+#include <sys/wait.h>   //  For waiting on server workers and benchmark clients.
+#include <signal.h>     //  For ignoring SIGPIPE when clients disconnect.
+#include <errno.h>      //  For retrying interrupted reads and writes.
+#include <time.h>       //  For timing the benchmark.
 
 /*  For unit testing */
 #ifdef TEST
@@ -24,6 +35,66 @@ struct Note {
     int midiNote; // Midi note number of note.
 };
 
+/*  Output writers take a finished sample and write it to <output> in their own format. */
+typedef void ( *SampleWriter )( double sample, FILE *output );
+
+struct RenderSettings {
+    double gain;              // Linear gain applied to every sample.
+    int fadeSamples;          // Length of the fade in and fade out in samples.
+    SampleWriter writeSample; // Output writer every processed sample is handed to.
+    FILE *output;             // Stream the output writer writes to.
+};
+
+struct ProgramOptions {
+    struct RenderSettings settings; // Stages applied to the output.
+    const char *compilePath;        // Where to write the compiled score, or NULL to print samples.
+    const char *scorePath;          // Compiled score to print instead of reading input, or NULL.
+    bool hasRange;                  // Print only samples [ rangeStart, rangeEnd ) when true.
+    unsigned long long rangeStart;
+    unsigned long long rangeEnd;
+    const char *servePath;          // Socket to serve renders on, or NULL.
+    int workerCount;                // Number of server workers.
+    const char *clientPath;         // Server socket to send the entered score to, or NULL.
+    const char *benchPath;          // Server socket to benchmark, or NULL.
+    int benchClients;               // Number of simultaneous benchmark clients.
+    int benchRequests;              // Number of requests made by each benchmark client.
+    const char *manifestPath;       // Manifest of the output being updated, or NULL.
+    const char *updatePath;         // Output file to update in place, or NULL.
+};
+
+/*  A note ready for printing. Also the note record of the compiled score file. */
+struct CompiledNote {
+    uint64_t startSample; // Position of the note's first sample within the whole output.
+    int32_t midiNote;    // Midi note number of note.
+    int32_t sampleCount; // Number of samples printed for note.
+    double frequency;    // Frequency of note in Hz.
+    double startPhase;   // Phase offset in radians of the note's first sample.
+};
+
+/*  Header at the start of a compiled score file, followed by <noteCount> CompiledNotes. */
+struct ScoreHeader {
+    char magic[ 4 ];        // Always g_scoreMagic.
+    uint32_t version;       // Format version, must match g_scoreVersion.
+    uint32_t noteCount;     // Number of notes following the header.
+    uint32_t reserved;      // Keeps the notes 8-byte aligned.
+    uint64_t totalSamples;  // Samples printed for the whole score.
+};
+
+/*  Header at the start of a render manifest, followed by the compiled score that was rendered. */
+struct ManifestHeader {
+    char magic[ 4 ];     // Always g_manifestMagic.
+    uint32_t version;    // Format version, must match g_manifestVersion.
+    double gain;         // Settings the output was rendered with. Any change means every sample
+    int32_t fadeSamples; // has to be rendered again.
+    int32_t sampleSize;  // Bytes per sample of the output format.
+};
+
+struct Score {
+    const struct CompiledNote *notes; // Notes in playing order, so sorted by startSample.
+    int noteCount;
+    unsigned long long totalSamples;  // Includes the extra sample printed after the final note.
+};
+
 /*  ERROR MESSAGES */
 enum ERR {
     NO_ERR,
@@ -38,6 +109,24 @@ const double g_pi = 3.14159265359;
 const double g_tau = 2 * g_pi;
 const double g_referenceMidiNote = 69;   // Midi note 69 is A above middle C.
 const double g_referenceFrequency = 440; // Desired frequency of g_referenceMidiNote.
+const int g_maxGainDecibels = 24;        // Limits of the "-gain" argument.
+const int g_minGainDecibels = -120;
+const char g_scoreMagic[ 4 ] = { 'M', 'O', 'S', 'C' }; // Identifies a compiled score file.
+const uint32_t g_scoreVersion = 2;                      // Bump when the file layout changes.
+const char g_manifestMagic[ 4 ] = { 'M', 'O', 'S', 'M' }; // Identifies a render manifest.
+const uint32_t g_manifestVersion = 1;
+const int g_maxWorkers = 64;                            // Limits of the server worker pool and
+const int g_maxBenchClients = 256;                      // benchmark arguments.
+const int g_maxBenchRequests = 1000000;
+const char g_benchScore[] = "0 60\n100 64\n200 67\n300 -1\n"; // Score each benchmark request sends.
+const char g_replyOk[] = "OK ";   // Starts the status line of every server reply that contains
+                                  // samples, followed by the number of bytes of samples. Any
+                                  // other reply is an error message.
+const int g_maxScoreLines = 100;     // Most lines of a score the server reads, and the most
+const int g_maxScoreLineLength = 31; // characters in each, including the newline.
+const int g_connectionTimeout = 5; // Seconds a server client has to send its score. Reading the
+                                   // reply may take as long again plus the length of the audio.
+const unsigned int g_outputCheckInterval = 256; // Samples printed between output error checks.
 
 /*  FUNCTION PROTOTYPES */
 
@@ -45,16 +134,45 @@ const double g_referenceFrequency = 440; // Desired frequency of g_referenceMidi
 
 /*      commandLineArgHandler()
  *  Passed command line arguments upon program start.
- *  Checks number of arguments:
- *      - Throws error if more than 2 arguments.
- *      - If exactly 2 calls detectHelp() on second argument.
- *      - If less than 2 returns to main function. */
-void commandLineArgHandler( int argc, const char *argv[] );
+ *  Walks through each argument in turn:
+ *      - "-help" prints help documentation via detectHelp() and exits.
+ *      - "-gain", "-fade", "-format", "-compile" and "-score" take the following argument as
+ *        their value and write it to <options>.
+ *      - "-range" takes the following two arguments as the first and end sample to print.
+ *      - "-serve", "-workers" and "-client" take the following argument as their value.
+ *      - "-bench" takes the following three arguments as the socket, clients and requests.
+ *      - "-update" takes the following two arguments as the manifest and output file.
+ *      - Anything else throws an error. */
+void commandLineArgHandler( int argc, const char *argv[], struct ProgramOptions *options );
 
 /*      detectHelp()
- *  Compares <string> to "-help". If equal, calls functions to print help documentation.
- *  Otherwise sends error message. */
-void detectHelp( const char *string[] );
+ *  Compares <string> to "-help". If equal, calls functions to print help documentation and exits.
+ *  Otherwise returns false. */
+bool detectHelp( const char *string );
+
+/*      argumentValue()
+ *  Returns the argument following <argv>[ *index ] and advances <index> past it. Throws error if
+ *  the flag at <index> is the last argument. */
+const char *argumentValue( int argc, const char *argv[], int *index );
+
+/*      parseIntArgument()
+ *  Converts command line value <string> to an int. Throws error if <string> is not an integer
+ *  between <min> and <max>. */
+int parseIntArgument( const char *string, int min, int max );
+
+/*      parseSampleArgument()
+ *  Converts command line value <string> to a sample position. Throws error if <string> is not a
+ *  non-negative integer. */
+unsigned long long parseSampleArgument( const char *string );
+
+/*      selectWriter()
+ *  Returns the output writer named by <format>: "text", "float" or "pcm16". Throws error if
+ *  <format> is not recognised. */
+SampleWriter selectWriter( const char *format );
+
+/*      sampleSize()
+ *  Returns the number of bytes <writer> writes for each sample, or 0 if this varies. */
+int sampleSize( SampleWriter writer );
 
 /*      sendHelp()
  *  Contains the help documentation, prints this using printWithBorder and exits program. */
@@ -70,15 +188,16 @@ void printWithBorder( char *message[], int rows, int borderWidth );
 
 /*      populateNotes()
  *  Takes in array of "struct Note" variables as <notes>.
- *  Handles populating array with data of up to <numberOfLines> Notes from user input. */
-void populateNotes( struct Note *notes, int numberOfLines );
+ *  Handles populating array with data of up to <numberOfLines> Notes from user input read from
+ *  <input>. */
+void populateNotes( struct Note *notes, int numberOfLines, FILE *input );
 
 /*      getUserInput()
- *  Populates <userInputBuffer> of size <inputBufferSize> with runtime input from user.
+ *  Populates <userInputBuffer> of size <inputBufferSize> with a line of user input from <input>.
  *  Handles validating data is in format of <int> <int>.
  *  Two extracted long ints are then written to <timestamp> and <midiNote> respectively. */
 bool getUserInput( char *userInputBuffer, const int inputBufferSize, long *timestamp,
-                  long *midiNote );
+                  long *midiNote, FILE *input );
 
 /*      separateArguments()
  *  Separates <userInputBuffer> into two separate strings which are written to <tempTime> and
@@ -117,13 +236,107 @@ bool withinDurationLimit( int duration, int noteIndex );
 
 /*  For printing out the notes */
 
-/*      printNotes()
- *  Handles printing an array <notes> of "struct Note" variables. */
-void printNotes( struct Note *notes );
+/*      compileNotes()
+ *  Converts the array <notes> of "struct Note" variables, ending in a negative midi note, into
+ *  <compiledNotes>. Works out the sample count, frequency and starting phase of every note so
+ *  printing needs no further state. Returns a Score referring to <compiledNotes>. */
+struct Score compileNotes( const struct Note *notes, struct CompiledNote *compiledNotes );
+
+/*      printScore()
+ *  Handles printing every note of <score> through the stages in <settings>. */
+void printScore( const struct Score *score, const struct RenderSettings *settings );
+
+/*      printRange()
+ *  Prints samples <first> up to but not including <end> of <score>, exactly as they appear in
+ *  the output of printScore(). Throws error if the range is empty or runs past the score. */
+void printRange( const struct Score *score, unsigned long long first, unsigned long long end,
+                const struct RenderSettings *settings );
+
+/*      findNoteAtSample()
+ *  Binary searches <score> for the index of the note containing sample <position>. The extra
+ *  sample after the final note belongs to the final note. */
+int findNoteAtSample( const struct Score *score, unsigned long long position );
 
 /*      printNote()
- *  Prints a single stuct Note <note>. */
-double printNote( struct Note note );
+ *  Prints samples <firstIndex> up to but not including <endIndex> of CompiledNote <note>.
+ *  <totalSamples> is the length of the whole output, as needed by the fades. */
+void printNote( const struct CompiledNote *note, int firstIndex, int endIndex,
+               unsigned long long totalSamples, const struct RenderSettings *settings );
+
+/*      noteSampleCount()
+ *  Returns the number of samples printed for <note>. */
+int noteSampleCount( struct Note note );
+
+/*  For compiled score files */
+
+/*      writeScore()
+ *  Writes <score> to the file at <path> in the compiled score format. */
+void writeScore( const char *path, const struct Score *score );
+
+/*      writeScoreData()
+ *  Writes <score> in the compiled score format to <file> at its current position. Returns false
+ *  on failure. */
+bool writeScoreData( FILE *file, const struct Score *score );
+
+/*      loadScore()
+ *  Memory maps the compiled score file at <path> and points <score> at its notes. Throws error if
+ *  the file is not a compiled score of the current version. */
+void loadScore( const char *path, struct Score *score );
+
+/*      readScore()
+ *  Points <score> at the notes of the compiled score held in the <size> bytes at <data>. Returns
+ *  false if <data> is not a compiled score of the current version, or its notes are not
+ *  consistent with each other and with its header. */
+bool readScore( const void *data, size_t size, struct Score *score );
+
+/*      mapFile()
+ *  Memory maps the whole file at <path> for reading and writes its length to <size>. Returns NULL
+ *  if the file cannot be mapped. */
+void *mapFile( const char *path, size_t *size );
+
+/*  For updating a previous output */
+
+/*      updateOutput()
+ *  Brings the output file at <outputPath> up to date with <score>. If the manifest at
+ *  <manifestPath> describes the file, only samples that differ are rendered and written in
+ *  place. Otherwise the whole file is rendered. The manifest is then rewritten to match. */
+void updateOutput( const char *manifestPath, const char *outputPath, const struct Score *score,
+                  const struct RenderSettings *settings );
+
+/*      patchOutput()
+ *  Renders the samples of <score> into <output> that differ from <previous>, which was rendered
+ *  into <output> with the same <settings>. Returns the number of samples rendered. */
+unsigned long long patchOutput( FILE *output, const struct Score *score,
+                               const struct Score *previous,
+                               const struct RenderSettings *settings );
+
+/*      seekToSample()
+ *  Moves <output> to sample <position> of a fixed size format with samples <size> bytes long.
+ *  Throws error if the seek fails. */
+void seekToSample( FILE *output, unsigned long long position, int size );
+
+/*      reusableRange()
+ *  Works out which samples of <note> are unchanged between outputs <previousTotal> and
+ *  <totalSamples> long, given the note is unchanged and at the same position. Samples inside
+ *  either output's fades are not reusable. Writes the range to <firstIndex> and <endIndex>. */
+void reusableRange( const struct CompiledNote *note, unsigned long long previousTotal,
+                   unsigned long long totalSamples, int fadeSamples, int *firstIndex,
+                   int *endIndex );
+
+/*      sameNote()
+ *  Returns true if <a> and <b> print identical samples at the same position. */
+bool sameNote( const struct CompiledNote *a, const struct CompiledNote *b );
+
+/*      loadManifest()
+ *  Memory maps the manifest at <path> and points <previous> at the score it records. Returns
+ *  false if there is no manifest or it was rendered with different <settings>. */
+bool loadManifest( const char *path, const struct RenderSettings *settings,
+                  struct Score *previous );
+
+/*      writeManifest()
+ *  Writes a manifest recording that <score> was rendered with <settings> to <path>. */
+void writeManifest( const char *path, const struct Score *score,
+                   const struct RenderSettings *settings );
 
 /*      midiToFrequency()
  *  Converts midi note number <midiNote> to a frequency. */
@@ -134,6 +347,105 @@ double midiToFrequency( const int midiNote );
  *  and <lastRadianAngle> (phase offset) parameters. */
 double calculateAngle( unsigned int sampleIndex, double frequency, double lastRadianAngle );
 
+/*  For the render server */
+
+/*      runServer()
+ *  Listens on the Unix domain socket at <socketPath> and keeps <workerCount> worker processes
+ *  serving renders with <settings>. A worker that stops after a bad request or a missed deadline
+ *  is replaced. Never returns. */
+void runServer( const char *socketPath, int workerCount, const struct RenderSettings *settings );
+
+/*      startWorker()
+ *  Forks a worker process that calls serveRequests() on <listener> with a new temporary file for
+ *  its replies. Throws error if either cannot be created. */
+void startWorker( int listener, const struct RenderSettings *settings );
+
+/*      serveRequests()
+ *  Accepts connections on <listener> one at a time. Each connection sends a score in the usual
+ *  input format. The samples are printed to <reply> first, so the connection can be sent a status
+ *  line with their length followed by the samples, or an error message, before being closed. A request that runs past its deadline ends the worker, so the pool replaces it.
+ *  Note arrays are kept between requests. Never returns. */
+void serveRequests( int listener, FILE *reply, const struct RenderSettings *settings );
+
+/*      connectToServer()
+ *  Returns a connection to the render server at <socketPath>. Throws error on failure. */
+int connectToServer( const char *socketPath );
+
+/*      runClient()
+ *  Sends the score on standard input, up to the line that ends it, to the render server at
+ *  <socketPath> and copies the samples in the reply to standard output. Throws error with the
+ *  server's message if the request failed, or if fewer samples arrived than the status line
+ *  promised. */
+void runClient( const char *socketPath );
+
+/*      endsScore()
+ *  Returns true if score input line <line> has a negative midi note, so it is the last line the
+ *  server reads. */
+bool endsScore( const char *line );
+
+/*      readReplyStatus()
+ *  Reads the first line of a server reply from <connection>. Returns true if samples follow, and
+ *  writes their length in bytes to <length>. Otherwise writes the error message, without its
+ *  newline, to <message> of <messageSize> and returns false. */
+bool readReplyStatus( int connection, long long *length, char *message, size_t messageSize );
+
+/*      runBenchmark()
+ *  Starts <clients> processes that each send <requests> renders of g_benchScore to the server at
+ *  <socketPath>, then prints the time taken and number of successful requests per second. Throws
+ *  error if any request failed. */
+void runBenchmark( const char *socketPath, int clients, int requests );
+
+/*      benchmarkClient()
+ *  Sends <requests> renders one after another to the server at <socketPath>. Returns the number
+ *  of requests that got all of their samples back. */
+int benchmarkClient( const char *socketPath, int requests );
+
+/*      copyStream()
+ *  Copies everything from file descriptor <from> to <to> until end of file. Returns the number of
+ *  bytes copied, or -1 on failure. */
+long long copyStream( int from, int to );
+
+/*      writeAll()
+ *  Writes all <length> bytes of <buffer> to file descriptor <to>. Returns false on failure. */
+bool writeAll( int to, const char *buffer, size_t length );
+
+/*      readAll()
+ *  Reads from file descriptor <from> until <length> bytes are in <buffer> or end of file. Returns
+ *  the number of bytes read, or -1 on failure. */
+long long readAll( int from, char *buffer, size_t length );
+
+/*  Render pipeline stages */
+
+/*      emitSample()
+ *  Runs oscillator output <sample> through each stage in <settings> and hands the result to the
+ *  output writer. All stages work on the single sample so the whole pipeline runs as one loop
+ *  with no intermediate buffers. <position> and <totalSamples> locate the sample in the output. */
+void emitSample( double sample, unsigned long long position, unsigned long long totalSamples,
+                const struct RenderSettings *settings );
+
+/*      fadeGain()
+ *  Returns the gain of a linear fade in and fade out, each of <fadeSamples> length, at sample
+ *  <position> of an output <totalSamples> long. */
+double fadeGain( unsigned long long position, unsigned long long totalSamples, int fadeSamples );
+
+/*      decibelsToGain()
+ *  Converts <decibels> to a linear gain. */
+double decibelsToGain( int decibels );
+
+/*  Output writers */
+
+/*      writeSampleText()
+ *  Prints <sample> to <output> as text to six decimal places, one sample per line. */
+void writeSampleText( double sample, FILE *output );
+
+/*      writeSampleFloat()
+ *  Writes <sample> to <output> as a raw native-endian 32-bit float. */
+void writeSampleFloat( double sample, FILE *output );
+
+/*      writeSamplePcm16()
+ *  Writes <sample> to <output> as a raw native-endian 16-bit integer, clipped to full scale. */
+void writeSamplePcm16( double sample, FILE *output );
+
 /*  Other */
 
 /*      error()
@@ -143,40 +455,200 @@ void error( const char *message, int code );
 /*  END OF PROTOTYPES */
 
 int main( int argc, const char * argv[] ) {
-    commandLineArgHandler( argc, argv );
+    struct ProgramOptions options = { { 1, 0, writeSampleText, stdout }, NULL, NULL, false, 0, 0,
+                                      NULL, 4, NULL, NULL, 0, 0, NULL, NULL };
+    commandLineArgHandler( argc, argv, &options );
+    
+    if ( options.servePath ) {
+        runServer( options.servePath, options.workerCount, &options.settings );
+    }
+    else if ( options.clientPath ) {
+        runClient( options.clientPath );
+        return NO_ERR;
+    }
+    else if ( options.benchPath ) {
+        runBenchmark( options.benchPath, options.benchClients, options.benchRequests );
+        return NO_ERR;
+    }
     
     int numberOfLines = 100;
     struct Note notes[ numberOfLines ];
+    struct CompiledNote compiledNotes[ numberOfLines ];
+    struct Score score;
+    
+    /* A compiled score has already been validated, so skip straight to printing */
+    if ( options.scorePath ) {
+        loadScore( options.scorePath, &score );
+    }
+    else {
+        populateNotes( notes, numberOfLines, stdin );
+        score = compileNotes( notes, compiledNotes );
+        
+        if ( options.compilePath ) {
+            writeScore( options.compilePath, &score );
+            return NO_ERR;
+        }
+    }
     
-    populateNotes( notes, numberOfLines );
+    if ( options.updatePath ) {
+        updateOutput( options.manifestPath, options.updatePath, &score, &options.settings );
+        return NO_ERR;
+    }
     
-    printNotes( notes );
+    if ( options.hasRange ) {
+        printRange( &score, options.rangeStart, options.rangeEnd, &options.settings );
+    }
+    else {
+        printScore( &score, &options.settings );
+    }
     
     return NO_ERR;
 }
 #endif
 
 
-void commandLineArgHandler( int argc, const char *argv[] ) {
-    if ( argc > 2 ) {
-        error( "Maximum of one runtime argument accepted.", BAD_COMMAND_LINE );
+void commandLineArgHandler( int argc, const char *argv[], struct ProgramOptions *options ) {
+    
+    struct RenderSettings *settings = &options->settings;
+    
+    for ( int index = 1; index < argc; ++index ) {
+        if ( detectHelp( argv[ index ] ) ) {} // Does not return if help requested
+        else if ( strcmp( argv[ index ], "-gain" ) == 0 ) {
+            settings->gain = decibelsToGain( parseIntArgument( argumentValue( argc, argv, &index ),
+                                                              g_minGainDecibels,
+                                                              g_maxGainDecibels ) );
+        }
+        else if ( strcmp( argv[ index ], "-fade" ) == 0 ) {
+            /* Limit fade length in milliseconds so the length in samples cannot overflow */
+            settings->fadeSamples = parseIntArgument( argumentValue( argc, argv, &index ), 0,
+                                                     INT_MAX / ( g_sampleRate / 1000 ) ) *
+                                    ( g_sampleRate / 1000 );
+        }
+        else if ( strcmp( argv[ index ], "-format" ) == 0 ) {
+            settings->writeSample = selectWriter( argumentValue( argc, argv, &index ) );
+        }
+        else if ( strcmp( argv[ index ], "-compile" ) == 0 ) {
+            options->compilePath = argumentValue( argc, argv, &index );
+        }
+        else if ( strcmp( argv[ index ], "-score" ) == 0 ) {
+            options->scorePath = argumentValue( argc, argv, &index );
+        }
+        else if ( strcmp( argv[ index ], "-range" ) == 0 ) {
+            options->hasRange = true;
+            options->rangeStart = parseSampleArgument( argumentValue( argc, argv, &index ) );
+            options->rangeEnd = parseSampleArgument( argumentValue( argc, argv, &index ) );
+        }
+        else if ( strcmp( argv[ index ], "-serve" ) == 0 ) {
+            options->servePath = argumentValue( argc, argv, &index );
+        }
+        else if ( strcmp( argv[ index ], "-workers" ) == 0 ) {
+            options->workerCount = parseIntArgument( argumentValue( argc, argv, &index ), 1,
+                                                    g_maxWorkers );
+        }
+        else if ( strcmp( argv[ index ], "-client" ) == 0 ) {
+            options->clientPath = argumentValue( argc, argv, &index );
+        }
+        else if ( strcmp( argv[ index ], "-bench" ) == 0 ) {
+            options->benchPath = argumentValue( argc, argv, &index );
+            options->benchClients = parseIntArgument( argumentValue( argc, argv, &index ), 1,
+                                                     g_maxBenchClients );
+            options->benchRequests = parseIntArgument( argumentValue( argc, argv, &index ), 1,
+                                                      g_maxBenchRequests );
+        }
+        else if ( strcmp( argv[ index ], "-update" ) == 0 ) {
+            options->manifestPath = argumentValue( argc, argv, &index );
+            options->updatePath = argumentValue( argc, argv, &index );
+        }
+        else {
+            error( "Format not recognised! Type \"-help\" for formatting specification.",
+                  BAD_COMMAND_LINE );
+        }
+    }
+    
+    /* A compiled score can be the input to an update, so is not counted as a mode of its own */
+    int modeCount = ( options->compilePath != NULL ) + ( options->servePath != NULL ) +
+                    ( options->clientPath != NULL ) + ( options->benchPath != NULL ) +
+                    ( options->updatePath != NULL );
+    if ( modeCount > 1 || ( options->scorePath && modeCount > ( options->updatePath != NULL ) ) ) {
+        error( "Only one of -compile, -score, -serve, -client, -bench and -update can be used at "
+              "once, or -score with -update.", BAD_COMMAND_LINE );
+    }
+    if ( options->hasRange && modeCount > 0 ) {
+        error( "A sample range can only be given when printing samples.", BAD_COMMAND_LINE );
     }
-    else if ( argc == 2 ) {
-        detectHelp( argv );
+    if ( options->updatePath && sampleSize( settings->writeSample ) == 0 ) {
+        error( "Updating an output needs a fixed size format. Use \"-format float\" or "
+              "\"-format pcm16\".", BAD_COMMAND_LINE );
     }
     return;
 }
 
 
-void detectHelp( const char *string[] ) {
-    if ( strcmp( string[1], "-help" ) == 0 ) {
+bool detectHelp( const char *string ) {
+    if ( strcmp( string, "-help" ) == 0 ) {
         sendHelp();
         exit( NO_ERR );
     }
-    else {
-        error( "Format not recognised! Type \"-help\" for formatting specification.",
-              BAD_COMMAND_LINE );
+    return false;
+}
+
+
+const char *argumentValue( int argc, const char *argv[], int *index ) {
+    if ( *index + 1 >= argc ) {
+        char errorMessage[ 50 ];
+        snprintf( errorMessage, sizeof( errorMessage ), "No value given for \"%s\".",
+                 argv[ *index ] );
+        error( errorMessage, BAD_COMMAND_LINE );
+    }
+    return argv[ ++( *index ) ];
+}
+
+
+int parseIntArgument( const char *string, int min, int max ) {
+    if ( !isOnlyInt( string ) || strlen( string ) == 0 ) {
+        error( "Command line values must be integers.", BAD_COMMAND_LINE );
+    }
+    long value = strtol( string, NULL, 10 );
+    if ( value < min || value > max ) {
+        error( "A command line value is out of range. Type \"-help\" for limits.",
+              OUT_OF_BOUNDS_VALUE );
+    }
+    return (int) value;
+}
+
+
+unsigned long long parseSampleArgument( const char *string ) {
+    if ( !isOnlyInt( string ) || strlen( string ) == 0 || string[ 0 ] == '-' ) {
+        error( "Sample positions must be non-negative integers.", BAD_COMMAND_LINE );
+    }
+    return strtoull( string, NULL, 10 );
+}
+
+
+SampleWriter selectWriter( const char *format ) {
+    if ( strcmp( format, "text" ) == 0 ) {
+        return writeSampleText;
     }
+    else if ( strcmp( format, "float" ) == 0 ) {
+        return writeSampleFloat;
+    }
+    else if ( strcmp( format, "pcm16" ) == 0 ) {
+        return writeSamplePcm16;
+    }
+    error( "Output format not recognised! Type \"-help\" for available formats.",
+          BAD_COMMAND_LINE );
+    return NULL;
+}
+
+
+int sampleSize( SampleWriter writer ) {
+    if ( writer == writeSampleFloat ) {
+        return sizeof( float );
+    }
+    else if ( writer == writeSamplePcm16 ) {
+        return sizeof( short );
+    }
+    return 0; // Text samples vary in length
 }
 
 
@@ -201,7 +673,41 @@ void sendHelp( void ) {
         "The program accepts up to 100 pairs of integers, so you can play fun tunes",
         "such as the Family Guy theme song.",
         "",
-        "Output will begin once the <midi note number> is set to a value less than 0."
+        "Output will begin once the <midi note number> is set to a value less than 0.",
+        "",
+        "The output can be shaped with the following options, which are all applied",
+        "as each sample is generated:",
+        "",
+        "-gain <decibels> applies a whole number gain between -120 and 24 dB.",
+        "-fade <milliseconds> adds a linear fade in and fade out.",
+        "-format <name> prints \"text\" (default), or raw native-endian \"float\" or",
+        "\"pcm16\" samples.",
+        "",
+        "Scores that are printed many times can be checked and compiled once:",
+        "",
+        "-compile <file> writes the entered notes to <file> instead of printing.",
+        "-score <file> prints the notes in compiled <file> without reading any input.",
+        "Compiled files are specific to the machine they were made on.",
+        "",
+        "-range <first> <end> prints only samples <first> up to but not including",
+        "<end>, counting from 0. These match the same samples of the full output.",
+        "",
+        "Many scores can be printed quickly by a server that stays running:",
+        "",
+        "-serve <socket> prints scores sent to the Unix domain <socket> using the",
+        "options above. Each connection sends one score.",
+        "-workers <count> sets how many scores the server prints at once, up to 64.",
+        "The default is 4.",
+        "-client <socket> sends the entered score to the server and prints the reply.",
+        "-bench <socket> <clients> <requests> times <clients> clients each sending",
+        "<requests> short scores to the server.",
+        "",
+        "An output file can be kept up to date with an edited score:",
+        "",
+        "-update <manifest> <output> writes the score to <output>, only rendering",
+        "samples that changed since <manifest> was written. Needs -format float or",
+        "pcm16. A changed note also changes the phase, so every note after it is",
+        "rendered again."
     };
     printWithBorder( helpText, ( sizeof( helpText ) / sizeof( helpText[ 0 ] ) ), 1 );
     return;
@@ -260,7 +766,7 @@ void printWithBorder( char *message[], int rows, int borderWidth ) {
 }
 
 
-void populateNotes( struct Note *notes, int numberOfLines ) {
+void populateNotes( struct Note *notes, int numberOfLines, FILE *input ) {
     
     const int inputBufferSize = 32; // 32 characters required by fgets for 30 user characters + '\n'
     char userInputBuffer[ inputBufferSize ] = { 0 };
@@ -268,7 +774,8 @@ void populateNotes( struct Note *notes, int numberOfLines ) {
     long tempTimestamp = 0, tempMidiNote = 0;
     
     do {
-        if ( !getUserInput( userInputBuffer, inputBufferSize, &tempTimestamp, &tempMidiNote ) ) {
+        if ( !getUserInput( userInputBuffer, inputBufferSize, &tempTimestamp, &tempMidiNote,
+                           input ) ) {
             error( "User input not in a recognised format.", BAD_RUNTIME_ARG );
         }
         
@@ -285,8 +792,8 @@ void populateNotes( struct Note *notes, int numberOfLines ) {
 
 
 bool getUserInput( char *userInputBuffer, const int inputBufferSize,
-                  long *timestamp, long *midiNote ) {
-    if ( fgets( userInputBuffer, inputBufferSize, stdin ) == NULL ) {
+                  long *timestamp, long *midiNote, FILE *input ) {
+    if ( fgets( userInputBuffer, inputBufferSize, input ) == NULL ) {
         return false;
     }
     /* Check that only up to 30 characters have been entered, and replace '\n' with '\0' */
@@ -421,42 +928,714 @@ bool withinDurationLimit( int duration, int noteIndex ) {
 }
 
 
-void printNotes( struct Note *notes ) {
+struct Score compileNotes( const struct Note *notes, struct CompiledNote *compiledNotes ) {
     
-    int noteIndex = 0;
-    double finalRadianAngle = 0;
+    struct Score score = { compiledNotes, 0, 1 }; // The extra sample after the final note
+    double lastRadianAngle = 0;
+    
+    while ( notes[ score.noteCount ].midiNote >= 0 ) {
+        struct CompiledNote *note = &compiledNotes[ score.noteCount ];
+        
+        note->midiNote = notes[ score.noteCount ].midiNote;
+        note->sampleCount = noteSampleCount( notes[ score.noteCount ] );
+        note->frequency = midiToFrequency( note->midiNote );
+        note->startPhase = lastRadianAngle;
+        note->startSample = score.totalSamples - 1;
+        
+        /* The radian value used to calulate the sample after this note is the starting phase of
+         * the next note. */
+        lastRadianAngle = calculateAngle( note->sampleCount, note->frequency, lastRadianAngle );
+        
+        score.totalSamples += note->sampleCount;
+        ++score.noteCount;
+    }
+    return score;
+}
+
+
+void printScore( const struct Score *score, const struct RenderSettings *settings ) {
+    printRange( score, 0, score->totalSamples, settings );
+    return;
+}
+
+
+void printRange( const struct Score *score, unsigned long long first, unsigned long long end,
+                const struct RenderSettings *settings ) {
     
-    while ( notes[ noteIndex ].midiNote >= 0 ) {
-            finalRadianAngle = printNote( notes[ noteIndex++ ] );
+    if ( first >= end || end > score->totalSamples ) {
+        error( "The sample range must not be empty and must be within the score.",
+              OUT_OF_BOUNDS_VALUE );
     }
     
-    /* In order to avoid phase issues, must print last sample of previous note at beginning of
-     * next note. This means that there will be one un-printed sample after the last note has
-     * 'finished' printing. This must then be printed to ensure the correct number of samples are
-     * printed for each note. */
-    printf( "%.6f\n", sin( finalRadianAngle ) );
-     
+    /* Start from the note containing the first sample. Every note knows its own starting phase,
+     * so nothing before it needs to be calculated. */
+    /* Stop if the output has failed, such as a server client that has stopped reading */
+    for ( int noteIndex = findNoteAtSample( score, first );
+         noteIndex < score->noteCount && first < end && !ferror( settings->output );
+         ++noteIndex ) {
+        
+        const struct CompiledNote *note = &score->notes[ noteIndex ];
+        unsigned long long noteEnd = note->startSample + note->sampleCount;
+        
+        /* In order to avoid phase issues, must print last sample of previous note at beginning
+         * of next note. This means that there will be one un-printed sample after the last note
+         * has 'finished' printing. This must then be printed to ensure the correct number of
+         * samples are printed for each note. It is the next sample of the last note. */
+        if ( noteIndex == score->noteCount - 1 ) {
+            ++noteEnd;
+        }
+        if ( noteEnd > end ) {
+            noteEnd = end;
+        }
+        
+        printNote( note, (int) ( first - note->startSample ), (int) ( noteEnd - note->startSample ),
+                  score->totalSamples, settings );
+        first = noteEnd;
+    }
+    return;
+}
+
+
+int findNoteAtSample( const struct Score *score, unsigned long long position ) {
+    
+    /* Find the last note starting at or before <position> */
+    int low = 0, high = score->noteCount - 1;
+    while ( low < high ) {
+        int middle = low + ( high - low + 1 ) / 2;
+        if ( score->notes[ middle ].startSample <= position ) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+
+void printNote( const struct CompiledNote *note, int firstIndex, int endIndex,
+               unsigned long long totalSamples, const struct RenderSettings *settings ) {
+    
+    for ( unsigned int sampleIndex = firstIndex; sampleIndex < endIndex; ++sampleIndex ) {
+        
+        /* Stop if the output has failed. Checking takes a lock, so only do it now and then. */
+        if ( sampleIndex % g_outputCheckInterval == 0 && ferror( settings->output ) ) {
+            break;
+        }
+        emitSample( sin( calculateAngle( sampleIndex, note->frequency, note->startPhase ) ),
+                   note->startSample + sampleIndex, totalSamples, settings );
+    }
     return;
 }
 
 
-double printNote( struct Note note ) {
+int noteSampleCount( struct Note note ) {
+    return note.duration * g_sampleRate / 1000;
+}
+
+
+void writeScore( const char *path, const struct Score *score ) {
+    
+    FILE *file = fopen( path, "wb" );
+    if ( !file ) {
+        error( "Could not open the compiled score file for writing.", BAD_COMMAND_LINE );
+    }
+    
+    if ( !writeScoreData( file, score ) || fclose( file ) != 0 ) {
+        error( "Could not write the compiled score file.", BAD_COMMAND_LINE );
+    }
+    return;
+}
+
+
+bool writeScoreData( FILE *file, const struct Score *score ) {
+    
+    struct ScoreHeader header = { { 0 }, g_scoreVersion, (uint32_t) score->noteCount, 0,
+                                  score->totalSamples };
+    memcpy( header.magic, g_scoreMagic, sizeof( header.magic ) );
+    
+    return fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+           fwrite( score->notes, sizeof( *score->notes ), score->noteCount, file ) ==
+               score->noteCount;
+}
+
+
+void loadScore( const char *path, struct Score *score ) {
+    
+    /* Notes are read straight from the mapping. Pages are only loaded as printing reaches them. */
+    size_t size = 0;
+    void *mapping = mapFile( path, &size );
+    if ( !mapping ) {
+        error( "Could not open the compiled score file.", BAD_COMMAND_LINE );
+    }
+    
+    if ( !readScore( mapping, size, score ) ) {
+        error( "The compiled score file is damaged, not in a recognised format, or was compiled "
+              "by a different version.", BAD_COMMAND_LINE );
+    }
+    return;
+}
+
+
+bool readScore( const void *data, size_t size, struct Score *score ) {
+    
+    if ( size < sizeof( struct ScoreHeader ) ) {
+        return false;
+    }
+    
+    /* Check the header describes exactly the notes that follow it */
+    const struct ScoreHeader *header = data;
+    if ( memcmp( header->magic, g_scoreMagic, sizeof( header->magic ) ) != 0 ||
+        header->version != g_scoreVersion || header->noteCount < 1 ||
+        size != sizeof( *header ) + (size_t) header->noteCount * sizeof( struct CompiledNote ) ) {
+        return false;
+    }
+    
+    /* Check each note follows straight on from the last, and the samples add up to the total */
+    const struct CompiledNote *notes = (const struct CompiledNote *) ( header + 1 );
+    unsigned long long noteStart = 0;
+    for ( uint32_t noteIndex = 0; noteIndex < header->noteCount; ++noteIndex ) {
+        if ( notes[ noteIndex ].sampleCount <= 0 || notes[ noteIndex ].startSample != noteStart ||
+            !isfinite( notes[ noteIndex ].frequency ) || notes[ noteIndex ].frequency <= 0 ||
+            !isfinite( notes[ noteIndex ].startPhase ) ) {
+            return false;
+        }
+        noteStart += notes[ noteIndex ].sampleCount;
+    }
+    if ( header->totalSamples != noteStart + 1 ) { // The extra sample after the final note
+        return false;
+    }
+    
+    score->notes = notes;
+    score->noteCount = (int) header->noteCount;
+    score->totalSamples = header->totalSamples;
+    return true;
+}
+
+
+void *mapFile( const char *path, size_t *size ) {
+    
+    int file = open( path, O_RDONLY );
+    struct stat fileStatus;
+    if ( file < 0 ) {
+        return NULL;
+    }
+    if ( fstat( file, &fileStatus ) != 0 || fileStatus.st_size == 0 ) {
+        close( file );
+        return NULL;
+    }
+    
+    void *mapping = mmap( NULL, fileStatus.st_size, PROT_READ, MAP_PRIVATE, file, 0 );
+    close( file ); // Mapping stays valid after the file is closed
+    if ( mapping == MAP_FAILED ) {
+        return NULL;
+    }
     
-    /* Phase offset angle is stored between function calls. */
-    static double lastRadianAngle = 0;
+    *size = fileStatus.st_size;
+    return mapping;
+}
+
 
-    double frequency = midiToFrequency(note.midiNote);
+void updateOutput( const char *manifestPath, const char *outputPath, const struct Score *score,
+                  const struct RenderSettings *settings ) {
+    
+    struct RenderSettings fileSettings = *settings;
+    struct Score previous;
+    struct stat outputStatus;
+    unsigned long long renderedSamples = score->totalSamples;
+    
+    /* The previous output can only be patched if the manifest describes it exactly */
+    bool canPatch = loadManifest( manifestPath, settings, &previous ) &&
+                    stat( outputPath, &outputStatus ) == 0 &&
+                    outputStatus.st_size == previous.totalSamples *
+                                            sampleSize( settings->writeSample );
+    
+    /* Remove the manifest first, so an interrupted update can never be mistaken for a finished
+     * one. The mapping of the previous score stays valid. */
+    unlink( manifestPath );
     
-    for ( unsigned int sampleIndex = 0;
-         sampleIndex < note.duration * g_sampleRate / 1000; ++sampleIndex ) {
-        printf( "%.6f\n", sin( calculateAngle( sampleIndex, frequency, lastRadianAngle ) ) );
+    fileSettings.output = fopen( outputPath, canPatch ? "r+b" : "wb" );
+    if ( !fileSettings.output ) {
+        error( "Could not open the output file for writing.", BAD_COMMAND_LINE );
     }
     
-    /* Store the radian value used to calulate NEXT sample as this will be the starting sample of
-       the next oscillation. */
-    lastRadianAngle = calculateAngle( note.duration * g_sampleRate / 1000,
-                                     frequency, lastRadianAngle );
-    return lastRadianAngle; // Return this so it can be printed after final note generated.
+    if ( canPatch ) {
+        renderedSamples = patchOutput( fileSettings.output, score, &previous, &fileSettings );
+    }
+    else {
+        printScore( score, &fileSettings );
+    }
+    
+    /* Printing stops quietly when a write fails, so check before the manifest says the output is
+     * up to date */
+    if ( ferror( fileSettings.output ) || fflush( fileSettings.output ) != 0 ||
+        ftruncate( fileno( fileSettings.output ),
+                  (off_t) ( score->totalSamples * sampleSize( settings->writeSample ) ) ) != 0 ||
+        fclose( fileSettings.output ) != 0 ) {
+        error( "Could not write the output file.", BAD_RUNTIME_ARG );
+    }
+    
+    writeManifest( manifestPath, score, settings );
+    
+    printf( "Rendered %llu of %llu samples.\n", renderedSamples, score->totalSamples );
+    return;
+}
+
+
+unsigned long long patchOutput( FILE *output, const struct Score *score,
+                               const struct Score *previous,
+                               const struct RenderSettings *settings ) {
+    
+    int size = sampleSize( settings->writeSample );
+    unsigned long long renderedSamples = 0;
+    
+    for ( int noteIndex = 0; noteIndex < score->noteCount; ++noteIndex ) {
+        
+        const struct CompiledNote *note = &score->notes[ noteIndex ];
+        int firstReusable = 0, endReusable = 0;
+        
+        /* Start phase carries on from the previous note, so a note that has changed usually
+         * changes every note after it too. Those are found here and rendered again. */
+        if ( noteIndex < previous->noteCount &&
+            sameNote( note, &previous->notes[ noteIndex ] ) ) {
+            reusableRange( note, previous->totalSamples, score->totalSamples,
+                          settings->fadeSamples, &firstReusable, &endReusable );
+        }
+        
+        /* Render the samples either side of the reusable ones */
+        if ( firstReusable > 0 ) {
+            seekToSample( output, note->startSample, size );
+            printNote( note, 0, firstReusable, score->totalSamples, settings );
+        }
+        if ( endReusable < note->sampleCount ) {
+            seekToSample( output, note->startSample + endReusable, size );
+            printNote( note, endReusable, note->sampleCount, score->totalSamples, settings );
+        }
+        renderedSamples += note->sampleCount - ( endReusable - firstReusable );
+    }
+    
+    /* The extra sample after the final note always moves with the end of the output */
+    seekToSample( output, score->totalSamples - 1, size );
+    printRange( score, score->totalSamples - 1, score->totalSamples, settings );
+    
+    return renderedSamples + 1;
+}
+
+
+void seekToSample( FILE *output, unsigned long long position, int size ) {
+    if ( fseeko( output, (off_t) ( position * size ), SEEK_SET ) != 0 ) {
+        error( "Could not write the output file.", BAD_RUNTIME_ARG );
+    }
+    return;
+}
+
+
+void reusableRange( const struct CompiledNote *note, unsigned long long previousTotal,
+                   unsigned long long totalSamples, int fadeSamples, int *firstIndex,
+                   int *endIndex ) {
+    
+    /* Samples between the fade in and the fade out of both outputs have a fade gain of 1 */
+    unsigned long long first = fadeSamples, end = note->startSample + note->sampleCount;
+    unsigned long long shorterTotal = previousTotal < totalSamples ? previousTotal : totalSamples;
+    
+    if ( first < note->startSample ) {
+        first = note->startSample;
+    }
+    if ( fadeSamples > 0 && end > shorterTotal - fadeSamples ) {
+        end = shorterTotal > fadeSamples ? shorterTotal - fadeSamples : 0;
+    }
+    
+    if ( first >= end ) {
+        *firstIndex = *endIndex = 0;
+        return;
+    }
+    *firstIndex = (int) ( first - note->startSample );
+    *endIndex = (int) ( end - note->startSample );
+    return;
+}
+
+
+bool sameNote( const struct CompiledNote *a, const struct CompiledNote *b ) {
+    return a->startSample == b->startSample && a->sampleCount == b->sampleCount &&
+           a->frequency == b->frequency && a->startPhase == b->startPhase;
+}
+
+
+bool loadManifest( const char *path, const struct RenderSettings *settings,
+                  struct Score *previous ) {
+    
+    size_t size = 0;
+    const struct ManifestHeader *header = mapFile( path, &size );
+    if ( !header ) {
+        return false;
+    }
+    
+    return size >= sizeof( *header ) &&
+           memcmp( header->magic, g_manifestMagic, sizeof( header->magic ) ) == 0 &&
+           header->version == g_manifestVersion && header->gain == settings->gain &&
+           header->fadeSamples == settings->fadeSamples &&
+           header->sampleSize == sampleSize( settings->writeSample ) &&
+           readScore( header + 1, size - sizeof( *header ), previous );
+}
+
+
+void writeManifest( const char *path, const struct Score *score,
+                   const struct RenderSettings *settings ) {
+    
+    struct ManifestHeader header = { { 0 }, g_manifestVersion, settings->gain,
+                                     settings->fadeSamples, sampleSize( settings->writeSample ) };
+    memcpy( header.magic, g_manifestMagic, sizeof( header.magic ) );
+    
+    FILE *file = fopen( path, "wb" );
+    if ( !file ) {
+        error( "Could not open the manifest file for writing.", BAD_COMMAND_LINE );
+    }
+    
+    if ( fwrite( &header, sizeof( header ), 1, file ) != 1 || !writeScoreData( file, score ) ||
+        fclose( file ) != 0 ) {
+        error( "Could not write the manifest file.", BAD_COMMAND_LINE );
+    }
+    return;
+}
+
+
+void runServer( const char *socketPath, int workerCount, const struct RenderSettings *settings ) {
+    
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if ( strlen( socketPath ) >= sizeof( address.sun_path ) ) {
+        error( "The socket path is too long.", BAD_COMMAND_LINE );
+    }
+    strcpy( address.sun_path, socketPath );
+    
+    int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    unlink( socketPath ); // Remove any socket left behind by a previous server
+    if ( listener < 0 || bind( listener, (struct sockaddr *) &address, sizeof( address ) ) != 0 ||
+        listen( listener, SOMAXCONN ) != 0 ) {
+        error( "Could not listen on the socket.", BAD_COMMAND_LINE );
+    }
+    
+    /* A client disconnecting early should not stop the worker printing its samples */
+    signal( SIGPIPE, SIG_IGN );
+    
+    printf( "Serving on %s with %d workers.\n", socketPath, workerCount );
+    fflush( stdout ); // Nothing may be left buffered for the workers to inherit
+    
+    for ( int worker = 0; worker < workerCount; ++worker ) {
+        startWorker( listener, settings );
+    }
+    
+    /* Workers only stop after a bad request or a missed deadline, so keep the pool full */
+    while ( true ) {
+        if ( wait( NULL ) > 0 ) {
+            startWorker( listener, settings );
+        }
+    }
+}
+
+
+void startWorker( int listener, const struct RenderSettings *settings ) {
+    FILE *reply = tmpfile();
+    pid_t pid = reply ? fork() : -1;
+    if ( pid < 0 ) {
+        error( "Could not start a server worker.", BAD_RUNTIME_ARG );
+    }
+    else if ( pid == 0 ) {
+        serveRequests( listener, reply, settings );
+    }
+    fclose( reply ); // Only the worker uses it
+    return;
+}
+
+
+void serveRequests( int listener, FILE *reply, const struct RenderSettings *settings ) {
+    
+    int numberOfLines = g_maxScoreLines;
+    struct Note notes[ numberOfLines ];
+    struct CompiledNote compiledNotes[ numberOfLines ];
+    struct RenderSettings replySettings = *settings;
+    replySettings.output = reply;
+    
+    /* Standard output is line buffered if the server was started from a terminal, and a worker
+     * keeps that mode when standard output becomes a connection. That would split the status
+     * line and error messages into more writes than needed, so buffer fully. */
+    setvbuf( stdout, NULL, _IOFBF, BUFSIZ );
+    
+    while ( true ) {
+        int connection = accept( listener, NULL, NULL );
+        if ( connection < 0 ) {
+            continue;
+        }
+        
+        /* A timeout on each read or write would let a client that trickles data hold this worker
+         * forever, so the whole request has a deadline instead. SIGALRM ends the worker when it
+         * passes. */
+        alarm( g_connectionTimeout );
+        
+        /* Samples and error messages are both printed to standard output, so point it at the
+         * connection. An error message ends this worker and is the last thing the client gets. */
+        FILE *input = fdopen( connection, "r" );
+        dup2( connection, STDOUT_FILENO );
+        clearerr( stdout );
+        
+        populateNotes( notes, numberOfLines, input );
+        struct Score score = compileNotes( notes, compiledNotes );
+        
+        /* A client reading slower than the audio plays back has fallen too far behind */
+        alarm( g_connectionTimeout + (unsigned int) ( score.totalSamples / g_sampleRate ) );
+        
+        /* Text samples vary in length, so print them all before the status line can give it */
+        rewind( reply );
+        if ( ftruncate( fileno( reply ), 0 ) != 0 ) {
+            error( "Could not prepare the reply.", BAD_RUNTIME_ARG );
+        }
+        printScore( &score, &replySettings );
+        if ( fflush( reply ) != 0 || ferror( reply ) ) {
+            error( "Could not prepare the reply.", BAD_RUNTIME_ARG );
+        }
+        
+        /* Nothing else can fail now, so tell the client how much to expect and send it */
+        printf( "%s%lld\n", g_replyOk, (long long) ftello( reply ) );
+        fflush( stdout );
+        lseek( fileno( reply ), 0, SEEK_SET );
+        copyStream( fileno( reply ), STDOUT_FILENO );
+        
+        shutdown( connection, SHUT_RDWR ); // Standard output still refers to the connection
+        fclose( input );
+        alarm( 0 );
+    }
+}
+
+
+int connectToServer( const char *socketPath ) {
+    
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if ( strlen( socketPath ) >= sizeof( address.sun_path ) ) {
+        error( "The socket path is too long.", BAD_COMMAND_LINE );
+    }
+    strcpy( address.sun_path, socketPath );
+    
+    int connection = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( connection < 0 ||
+        connect( connection, (struct sockaddr *) &address, sizeof( address ) ) != 0 ) {
+        error( "Could not connect to the server.", BAD_COMMAND_LINE );
+    }
+    return connection;
+}
+
+
+void runClient( const char *socketPath ) {
+    
+    int connection = connectToServer( socketPath );
+    
+    /* The score is sent before the reply is read, so send only what the server will read. That
+     * fits in the socket buffer, so sending cannot block while the server sends samples back.
+     * A line without a newline is too long or the end of the input, and is always the last. */
+    char line[ g_maxScoreLineLength + 1 ];
+    for ( int lineCount = 0; lineCount < g_maxScoreLines && fgets( line, sizeof( line ), stdin );
+         ++lineCount ) {
+        if ( !writeAll( connection, line, strlen( line ) ) ) {
+            error( "Could not send the score to the server.", BAD_RUNTIME_ARG );
+        }
+        if ( !strchr( line, '\n' ) || endsScore( line ) ) {
+            break;
+        }
+    }
+    shutdown( connection, SHUT_WR );
+    
+    char message[ 256 ];
+    long long length = 0;
+    if ( !readReplyStatus( connection, &length, message, sizeof( message ) ) ) {
+        error( message, BAD_RUNTIME_ARG );
+    }
+    
+    /* A worker that failed part way through closes the connection early */
+    if ( copyStream( connection, STDOUT_FILENO ) != length ) {
+        error( "Could not read the whole reply from the server.", BAD_RUNTIME_ARG );
+    }
+    close( connection );
+    return;
+}
+
+
+bool endsScore( const char *line ) {
+    
+    /* separateArguments() changes the line, so work on a copy */
+    char copy[ g_maxScoreLineLength + 1 ];
+    strncpy( copy, line, sizeof( copy ) - 1 );
+    copy[ sizeof( copy ) - 1 ] = '\0';
+    copy[ strcspn( copy, "\n" ) ] = '\0';
+    
+    char *tempTime = NULL, *tempNote = NULL;
+    return separateArguments( copy, &tempTime, &tempNote ) && isOnlyInt( tempNote ) &&
+           strtol( tempNote, NULL, 10 ) < 0;
+}
+
+
+bool readReplyStatus( int connection, long long *length, char *message, size_t messageSize ) {
+    
+    /* Read one byte at a time so nothing after the status line is taken from the samples */
+    size_t lineLength = 0;
+    char character = '\0';
+    while ( lineLength < messageSize - 1 && readAll( connection, &character, 1 ) == 1 &&
+           character != '\n' ) {
+        message[ lineLength++ ] = character;
+    }
+    message[ lineLength ] = '\0';
+    
+    const char *byteCount = message + strlen( g_replyOk );
+    if ( character == '\n' && strncmp( message, g_replyOk, strlen( g_replyOk ) ) == 0 &&
+        byteCount[ 0 ] >= '0' && byteCount[ 0 ] <= '9' && isOnlyInt( byteCount ) ) {
+        *length = strtoll( byteCount, NULL, 10 );
+        return true;
+    }
+    
+    /* Anything else is an error message */
+    if ( message[ 0 ] == '\0' ) {
+        strncpy( message, "The server closed the connection without replying.", messageSize - 1 );
+        message[ messageSize - 1 ] = '\0';
+    }
+    return false;
+}
+
+
+void runBenchmark( const char *socketPath, int clients, int requests ) {
+    
+    /* Each client writes how many of its requests succeeded to this pipe. A small write to a pipe
+     * is never split, so the counts cannot mix. */
+    int results[ 2 ];
+    if ( pipe( results ) != 0 ) {
+        error( "Could not start the benchmark.", BAD_RUNTIME_ARG );
+    }
+    
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    
+    for ( int client = 0; client < clients; ++client ) {
+        pid_t pid = fork();
+        if ( pid < 0 ) {
+            error( "Could not start a benchmark client.", BAD_RUNTIME_ARG );
+        }
+        else if ( pid == 0 ) {
+            close( results[ 0 ] );
+            int succeeded = benchmarkClient( socketPath, requests );
+            exit( writeAll( results[ 1 ], (const char *) &succeeded, sizeof( succeeded ) ) ?
+                 NO_ERR : BAD_RUNTIME_ARG );
+        }
+    }
+    close( results[ 1 ] ); // So reading ends once every client has finished
+    
+    /* A client that could not connect exits without writing a count, so adds nothing */
+    long long succeededRequests = 0;
+    int succeeded = 0;
+    while ( readAll( results[ 0 ], (char *) &succeeded, sizeof( succeeded ) ) ==
+           sizeof( succeeded ) ) {
+        succeededRequests += succeeded;
+    }
+    close( results[ 0 ] );
+    while ( wait( NULL ) > 0 ) {}
+    
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    double seconds = ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    long long totalRequests = (long long) clients * requests;
+    
+    printf( "%d clients made %lld of %lld requests successfully in %.3f seconds: %.1f requests "
+           "per second.\n", clients, succeededRequests, totalRequests, seconds,
+           succeededRequests / seconds );
+    if ( succeededRequests < totalRequests ) {
+        char errorMessage[ 50 ];
+        snprintf( errorMessage, sizeof( errorMessage ), "%lld benchmark requests failed.",
+                 totalRequests - succeededRequests );
+        error( errorMessage, BAD_RUNTIME_ARG );
+    }
+    return;
+}
+
+
+int benchmarkClient( const char *socketPath, int requests ) {
+    
+    int discard = open( "/dev/null", O_WRONLY );
+    int succeeded = 0;
+    char message[ 256 ];
+    
+    for ( int request = 0; request < requests; ++request ) {
+        int connection = connectToServer( socketPath );
+        
+        /* Only a reply with as many bytes of samples as its status line gave counts */
+        long long length = 0;
+        if ( writeAll( connection, g_benchScore, strlen( g_benchScore ) ) &&
+            shutdown( connection, SHUT_WR ) == 0 &&
+            readReplyStatus( connection, &length, message, sizeof( message ) ) &&
+            copyStream( connection, discard ) == length ) {
+            ++succeeded;
+        }
+        close( connection );
+    }
+    close( discard );
+    return succeeded;
+}
+
+
+long long copyStream( int from, int to ) {
+    
+    char buffer[ 65536 ];
+    long long total = 0;
+    
+    while ( true ) {
+        ssize_t length = read( from, buffer, sizeof( buffer ) );
+        if ( length < 0 && errno == EINTR ) {
+            continue;
+        }
+        else if ( length < 0 ) {
+            return -1;
+        }
+        else if ( length == 0 ) {
+            return total;
+        }
+        
+        if ( !writeAll( to, buffer, length ) ) {
+            return -1;
+        }
+        total += length;
+    }
+}
+
+
+long long readAll( int from, char *buffer, size_t length ) {
+    
+    long long total = 0;
+    
+    while ( total < length ) {
+        ssize_t received = read( from, buffer + total, length - total );
+        if ( received < 0 && errno == EINTR ) {
+            continue;
+        }
+        else if ( received < 0 ) {
+            return -1;
+        }
+        else if ( received == 0 ) {
+            break;
+        }
+        total += received;
+    }
+    return total;
+}
+
+
+bool writeAll( int to, const char *buffer, size_t length ) {
+    while ( length > 0 ) {
+        ssize_t written = write( to, buffer, length );
+        if ( written < 0 && errno == EINTR ) {
+            continue;
+        }
+        else if ( written < 0 ) {
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return true;
 }
 
 
@@ -470,6 +1649,66 @@ double calculateAngle( unsigned int sampleIndex, double frequency, double lastRa
 }
 
 
+void emitSample( double sample, unsigned long long position, unsigned long long totalSamples,
+                const struct RenderSettings *settings ) {
+    sample *= settings->gain;
+    
+    if ( settings->fadeSamples > 0 ) {
+        sample *= fadeGain( position, totalSamples, settings->fadeSamples );
+    }
+    
+    settings->writeSample( sample, settings->output );
+}
+
+
+double fadeGain( unsigned long long position, unsigned long long totalSamples, int fadeSamples ) {
+    
+    if ( fadeSamples <= 0 ) {
+        return 1;
+    }
+    
+    /* Distance in samples from the nearest end of the output */
+    unsigned long long fromEnd = totalSamples - 1 - position;
+    unsigned long long nearest = position < fromEnd ? position : fromEnd;
+    
+    if ( nearest >= fadeSamples ) {
+        return 1;
+    }
+    return (double) nearest / fadeSamples;
+}
+
+
+double decibelsToGain( int decibels ) {
+    return pow( 10, decibels / 20. );
+}
+
+
+void writeSampleText( double sample, FILE *output ) {
+    fprintf( output, "%.6f\n", sample );
+}
+
+
+void writeSampleFloat( double sample, FILE *output ) {
+    float value = (float) sample;
+    fwrite( &value, sizeof( value ), 1, output );
+}
+
+
+void writeSamplePcm16( double sample, FILE *output ) {
+    
+    /* Clip to full scale before conversion */
+    if ( sample > 1 ) {
+        sample = 1;
+    }
+    else if ( sample < -1 ) {
+        sample = -1;
+    }
+    
+    short value = (short) lrint( sample * SHRT_MAX );
+    fwrite( &value, sizeof( value ), 1, output );
+}
+
+
 void error( const char *message, int errorCode ) {
     printf( "%s\n", message );
     exit( errorCode );
@@ -1,6 +1,8 @@
 #ifndef TEST_H
 #define TEST_H
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
 
 
 /*  STRUCTS */
@@ -9,6 +11,66 @@ struct Note {
     int midiNote; // Midi note number of note.
 };
 
+/*  Output writers take a finished sample and write it to <output> in their own format. */
+typedef void ( *SampleWriter )( double sample, FILE *output );
+
+struct RenderSettings {
+    double gain;              // Linear gain applied to every sample.
+    int fadeSamples;          // Length of the fade in and fade out in samples.
+    SampleWriter writeSample; // Output writer every processed sample is handed to.
+    FILE *output;             // Stream the output writer writes to.
+};
+
+struct ProgramOptions {
+    struct RenderSettings settings; // Stages applied to the output.
+    const char *compilePath;        // Where to write the compiled score, or NULL to print samples.
+    const char *scorePath;          // Compiled score to print instead of reading input, or NULL.
+    bool hasRange;                  // Print only samples [ rangeStart, rangeEnd ) when true.
+    unsigned long long rangeStart;
+    unsigned long long rangeEnd;
+    const char *servePath;          // Socket to serve renders on, or NULL.
+    int workerCount;                // Number of server workers.
+    const char *clientPath;         // Server socket to send the entered score to, or NULL.
+    const char *benchPath;          // Server socket to benchmark, or NULL.
+    int benchClients;               // Number of simultaneous benchmark clients.
+    int benchRequests;              // Number of requests made by each benchmark client.
+    const char *manifestPath;       // Manifest of the output being updated, or NULL.
+    const char *updatePath;         // Output file to update in place, or NULL.
+};
+
+/*  A note ready for printing. Also the note record of the compiled score file. */
+struct CompiledNote {
+    uint64_t startSample; // Position of the note's first sample within the whole output.
+    int32_t midiNote;    // Midi note number of note.
+    int32_t sampleCount; // Number of samples printed for note.
+    double frequency;    // Frequency of note in Hz.
+    double startPhase;   // Phase offset in radians of the note's first sample.
+};
+
+/*  Header at the start of a compiled score file, followed by <noteCount> CompiledNotes. */
+struct ScoreHeader {
+    char magic[ 4 ];        // Always g_scoreMagic.
+    uint32_t version;       // Format version, must match g_scoreVersion.
+    uint32_t noteCount;     // Number of notes following the header.
+    uint32_t reserved;      // Keeps the notes 8-byte aligned.
+    uint64_t totalSamples;  // Samples printed for the whole score.
+};
+
+/*  Header at the start of a render manifest, followed by the compiled score that was rendered. */
+struct ManifestHeader {
+    char magic[ 4 ];     // Always g_manifestMagic.
+    uint32_t version;    // Format version, must match g_manifestVersion.
+    double gain;         // Settings the output was rendered with. Any change means every sample
+    int32_t fadeSamples; // has to be rendered again.
+    int32_t sampleSize;  // Bytes per sample of the output format.
+};
+
+struct Score {
+    const struct CompiledNote *notes; // Notes in playing order, so sorted by startSample.
+    int noteCount;
+    unsigned long long totalSamples;  // Includes the extra sample printed after the final note.
+};
+
 /*  ERROR MESSAGES */
 enum ERR {
     NO_ERR,
@@ -23,6 +85,24 @@ const double g_pi = 3.14159265359;
 const double g_tau = 2 * g_pi;
 const double g_referenceMidiNote = 69;   // Midi note 69 is A above middle C.
 const double g_referenceFrequency = 440; // Desired frequency of g_referenceMidiNote.
+const int g_maxGainDecibels = 24;        // Limits of the "-gain" argument.
+const int g_minGainDecibels = -120;
+const char g_scoreMagic[ 4 ] = { 'M', 'O', 'S', 'C' }; // Identifies a compiled score file.
+const uint32_t g_scoreVersion = 2;                      // Bump when the file layout changes.
+const char g_manifestMagic[ 4 ] = { 'M', 'O', 'S', 'M' }; // Identifies a render manifest.
+const uint32_t g_manifestVersion = 1;
+const int g_maxWorkers = 64;                            // Limits of the server worker pool and
+const int g_maxBenchClients = 256;                      // benchmark arguments.
+const int g_maxBenchRequests = 1000000;
+const char g_benchScore[] = "0 60\n100 64\n200 67\n300 -1\n"; // Score each benchmark request sends.
+const char g_replyOk[] = "OK ";   // Starts the status line of every server reply that contains
+                                  // samples, followed by the number of bytes of samples. Any
+                                  // other reply is an error message.
+const int g_maxScoreLines = 100;     // Most lines of a score the server reads, and the most
+const int g_maxScoreLineLength = 31; // characters in each, including the newline.
+const int g_connectionTimeout = 5; // Seconds a server client has to send its score. Reading the
+                                   // reply may take as long again plus the length of the audio.
+const unsigned int g_outputCheckInterval = 256; // Samples printed between output error checks.
 
 /*  FUNCTION PROTOTYPES */
 
@@ -30,16 +110,45 @@ const double g_referenceFrequency = 440; // Desired frequency of g_referenceMidi
 
 /*      commandLineArgHandler()
  *  Passed command line arguments upon program start.
- *  Checks number of arguments:
- *      - Throws error if more than 2 arguments.
- *      - If exactly 2 calls detectHelp() on second argument.
- *      - If less than 2 returns to main function. */
-void commandLineArgHandler( int argc, const char *argv[] );
+ *  Walks through each argument in turn:
+ *      - "-help" prints help documentation via detectHelp() and exits.
+ *      - "-gain", "-fade", "-format", "-compile" and "-score" take the following argument as
+ *        their value and write it to <options>.
+ *      - "-range" takes the following two arguments as the first and end sample to print.
+ *      - "-serve", "-workers" and "-client" take the following argument as their value.
+ *      - "-bench" takes the following three arguments as the socket, clients and requests.
+ *      - "-update" takes the following two arguments as the manifest and output file.
+ *      - Anything else throws an error. */
+void commandLineArgHandler( int argc, const char *argv[], struct ProgramOptions *options );
 
 /*      detectHelp()
- *  Compares <string> to "-help". If equal, calls functions to print help documentation.
- *  Otherwise sends error message. */
-void detectHelp( const char *string[] );
+ *  Compares <string> to "-help". If equal, calls functions to print help documentation and exits.
+ *  Otherwise returns false. */
+bool detectHelp( const char *string );
+
+/*      argumentValue()
+ *  Returns the argument following <argv>[ *index ] and advances <index> past it. Throws error if
+ *  the flag at <index> is the last argument. */
+const char *argumentValue( int argc, const char *argv[], int *index );
+
+/*      parseIntArgument()
+ *  Converts command line value <string> to an int. Throws error if <string> is not an integer
+ *  between <min> and <max>. */
+int parseIntArgument( const char *string, int min, int max );
+
+/*      parseSampleArgument()
+ *  Converts command line value <string> to a sample position. Throws error if <string> is not a
+ *  non-negative integer. */
+unsigned long long parseSampleArgument( const char *string );
+
+/*      selectWriter()
+ *  Returns the output writer named by <format>: "text", "float" or "pcm16". Throws error if
+ *  <format> is not recognised. */
+SampleWriter selectWriter( const char *format );
+
+/*      sampleSize()
+ *  Returns the number of bytes <writer> writes for each sample, or 0 if this varies. */
+int sampleSize( SampleWriter writer );
 
 /*      sendHelp()
  *  Contains the help documentation, prints this using printWithBorder and exits program. */
@@ -55,15 +164,16 @@ void printWithBorder( char *message[], int rows, int borderWidth );
 
 /*      populateNotes()
  *  Takes in array of "struct Note" variables as <notes>.
- *  Handles populating array with data of up to <numberOfLines> Notes from user input. */
-void populateNotes( struct Note *notes, int numberOfLines );
+ *  Handles populating array with data of up to <numberOfLines> Notes from user input read from
+ *  <input>. */
+void populateNotes( struct Note *notes, int numberOfLines, FILE *input );
 
 /*      getUserInput()
- *  Populates <userInputBuffer> of size <inputBufferSize> with runtime input from user.
+ *  Populates <userInputBuffer> of size <inputBufferSize> with a line of user input from <input>.
  *  Handles validating data is in format of <int> <int>.
  *  Two extracted long ints are then written to <timestamp> and <midiNote> respectively. */
 bool getUserInput( char *userInputBuffer, const int inputBufferSize, long *timestamp,
-                  long *midiNote );
+                  long *midiNote, FILE *input );
 
 /*      separateArguments()
  *  Separates <userInputBuffer> into two separate strings which are written to <tempTime> and
@@ -102,13 +212,107 @@ bool withinDurationLimit( int duration, int noteIndex );
 
 /*  For printing out the notes */
 
-/*      printNotes()
- *  Handles printing an array <notes> of "struct Note" variables. */
-void printNotes( struct Note *notes );
+/*      compileNotes()
+ *  Converts the array <notes> of "struct Note" variables, ending in a negative midi note, into
+ *  <compiledNotes>. Works out the sample count, frequency and starting phase of every note so
+ *  printing needs no further state. Returns a Score referring to <compiledNotes>. */
+struct Score compileNotes( const struct Note *notes, struct CompiledNote *compiledNotes );
+
+/*      printScore()
+ *  Handles printing every note of <score> through the stages in <settings>. */
+void printScore( const struct Score *score, const struct RenderSettings *settings );
+
+/*      printRange()
+ *  Prints samples <first> up to but not including <end> of <score>, exactly as they appear in
+ *  the output of printScore(). Throws error if the range is empty or runs past the score. */
+void printRange( const struct Score *score, unsigned long long first, unsigned long long end,
+                const struct RenderSettings *settings );
+
+/*      findNoteAtSample()
+ *  Binary searches <score> for the index of the note containing sample <position>. The extra
+ *  sample after the final note belongs to the final note. */
+int findNoteAtSample( const struct Score *score, unsigned long long position );
 
 /*      printNote()
- *  Prints a single stuct Note <note>. */
-double printNote( struct Note note );
+ *  Prints samples <firstIndex> up to but not including <endIndex> of CompiledNote <note>.
+ *  <totalSamples> is the length of the whole output, as needed by the fades. */
+void printNote( const struct CompiledNote *note, int firstIndex, int endIndex,
+               unsigned long long totalSamples, const struct RenderSettings *settings );
+
+/*      noteSampleCount()
+ *  Returns the number of samples printed for <note>. */
+int noteSampleCount( struct Note note );
+
+/*  For compiled score files */
+
+/*      writeScore()
+ *  Writes <score> to the file at <path> in the compiled score format. */
+void writeScore( const char *path, const struct Score *score );
+
+/*      writeScoreData()
+ *  Writes <score> in the compiled score format to <file> at its current position. Returns false
+ *  on failure. */
+bool writeScoreData( FILE *file, const struct Score *score );
+
+/*      loadScore()
+ *  Memory maps the compiled score file at <path> and points <score> at its notes. Throws error if
+ *  the file is not a compiled score of the current version. */
+void loadScore( const char *path, struct Score *score );
+
+/*      readScore()
+ *  Points <score> at the notes of the compiled score held in the <size> bytes at <data>. Returns
+ *  false if <data> is not a compiled score of the current version, or its notes are not
+ *  consistent with each other and with its header. */
+bool readScore( const void *data, size_t size, struct Score *score );
+
+/*      mapFile()
+ *  Memory maps the whole file at <path> for reading and writes its length to <size>. Returns NULL
+ *  if the file cannot be mapped. */
+void *mapFile( const char *path, size_t *size );
+
+/*  For updating a previous output */
+
+/*      updateOutput()
+ *  Brings the output file at <outputPath> up to date with <score>. If the manifest at
+ *  <manifestPath> describes the file, only samples that differ are rendered and written in
+ *  place. Otherwise the whole file is rendered. The manifest is then rewritten to match. */
+void updateOutput( const char *manifestPath, const char *outputPath, const struct Score *score,
+                  const struct RenderSettings *settings );
+
+/*      patchOutput()
+ *  Renders the samples of <score> into <output> that differ from <previous>, which was rendered
+ *  into <output> with the same <settings>. Returns the number of samples rendered. */
+unsigned long long patchOutput( FILE *output, const struct Score *score,
+                               const struct Score *previous,
+                               const struct RenderSettings *settings );
+
+/*      seekToSample()
+ *  Moves <output> to sample <position> of a fixed size format with samples <size> bytes long.
+ *  Throws error if the seek fails. */
+void seekToSample( FILE *output, unsigned long long position, int size );
+
+/*      reusableRange()
+ *  Works out which samples of <note> are unchanged between outputs <previousTotal> and
+ *  <totalSamples> long, given the note is unchanged and at the same position. Samples inside
+ *  either output's fades are not reusable. Writes the range to <firstIndex> and <endIndex>. */
+void reusableRange( const struct CompiledNote *note, unsigned long long previousTotal,
+                   unsigned long long totalSamples, int fadeSamples, int *firstIndex,
+                   int *endIndex );
+
+/*      sameNote()
+ *  Returns true if <a> and <b> print identical samples at the same position. */
+bool sameNote( const struct CompiledNote *a, const struct CompiledNote *b );
+
+/*      loadManifest()
+ *  Memory maps the manifest at <path> and points <previous> at the score it records. Returns
+ *  false if there is no manifest or it was rendered with different <settings>. */
+bool loadManifest( const char *path, const struct RenderSettings *settings,
+                  struct Score *previous );
+
+/*      writeManifest()
+ *  Writes a manifest recording that <score> was rendered with <settings> to <path>. */
+void writeManifest( const char *path, const struct Score *score,
+                   const struct RenderSettings *settings );
 
 /*      midiToFrequency()
  *  Converts midi note number <midiNote> to a frequency. */
@@ -119,6 +323,105 @@ double midiToFrequency( const int midiNote );
  *  and <lastRadianAngle> (phase offset) parameters. */
 double calculateAngle( unsigned int sampleIndex, double frequency, double lastRadianAngle );
 
+/*  For the render server */
+
+/*      runServer()
+ *  Listens on the Unix domain socket at <socketPath> and keeps <workerCount> worker processes
+ *  serving renders with <settings>. A worker that stops after a bad request or a missed deadline
+ *  is replaced. Never returns. */
+void runServer( const char *socketPath, int workerCount, const struct RenderSettings *settings );
+
+/*      startWorker()
+ *  Forks a worker process that calls serveRequests() on <listener> with a new temporary file for
+ *  its replies. Throws error if either cannot be created. */
+void startWorker( int listener, const struct RenderSettings *settings );
+
+/*      serveRequests()
+ *  Accepts connections on <listener> one at a time. Each connection sends a score in the usual
+ *  input format. The samples are printed to <reply> first, so the connection can be sent a status
+ *  line with their length followed by the samples, or an error message, before being closed. A request that runs past its deadline ends the worker, so the pool replaces it.
+ *  Note arrays are kept between requests. Never returns. */
+void serveRequests( int listener, FILE *reply, const struct RenderSettings *settings );
+
+/*      connectToServer()
+ *  Returns a connection to the render server at <socketPath>. Throws error on failure. */
+int connectToServer( const char *socketPath );
+
+/*      runClient()
+ *  Sends the score on standard input, up to the line that ends it, to the render server at
+ *  <socketPath> and copies the samples in the reply to standard output. Throws error with the
+ *  server's message if the request failed, or if fewer samples arrived than the status line
+ *  promised. */
+void runClient( const char *socketPath );
+
+/*      endsScore()
+ *  Returns true if score input line <line> has a negative midi note, so it is the last line the
+ *  server reads. */
+bool endsScore( const char *line );
+
+/*      readReplyStatus()
+ *  Reads the first line of a server reply from <connection>. Returns true if samples follow, and
+ *  writes their length in bytes to <length>. Otherwise writes the error message, without its
+ *  newline, to <message> of <messageSize> and returns false. */
+bool readReplyStatus( int connection, long long *length, char *message, size_t messageSize );
+
+/*      runBenchmark()
+ *  Starts <clients> processes that each send <requests> renders of g_benchScore to the server at
+ *  <socketPath>, then prints the time taken and number of successful requests per second. Throws
+ *  error if any request failed. */
+void runBenchmark( const char *socketPath, int clients, int requests );
+
+/*      benchmarkClient()
+ *  Sends <requests> renders one after another to the server at <socketPath>. Returns the number
+ *  of requests that got all of their samples back. */
+int benchmarkClient( const char *socketPath, int requests );
+
+/*      copyStream()
+ *  Copies everything from file descriptor <from> to <to> until end of file. Returns the number of
+ *  bytes copied, or -1 on failure. */
+long long copyStream( int from, int to );
+
+/*      writeAll()
+ *  Writes all <length> bytes of <buffer> to file descriptor <to>. Returns false on failure. */
+bool writeAll( int to, const char *buffer, size_t length );
+
+/*      readAll()
+ *  Reads from file descriptor <from> until <length> bytes are in <buffer> or end of file. Returns
+ *  the number of bytes read, or -1 on failure. */
+long long readAll( int from, char *buffer, size_t length );
+
+/*  Render pipeline stages */
+
+/*      emitSample()
+ *  Runs oscillator output <sample> through each stage in <settings> and hands the result to the
+ *  output writer. All stages work on the single sample so the whole pipeline runs as one loop
+ *  with no intermediate buffers. <position> and <totalSamples> locate the sample in the output. */
+void emitSample( double sample, unsigned long long position, unsigned long long totalSamples,
+                const struct RenderSettings *settings );
+
+/*      fadeGain()
+ *  Returns the gain of a linear fade in and fade out, each of <fadeSamples> length, at sample
+ *  <position> of an output <totalSamples> long. */
+double fadeGain( unsigned long long position, unsigned long long totalSamples, int fadeSamples );
+
+/*      decibelsToGain()
+ *  Converts <decibels> to a linear gain. */
+double decibelsToGain( int decibels );
+
+/*  Output writers */
+
+/*      writeSampleText()
+ *  Prints <sample> to <output> as text to six decimal places, one sample per line. */
+void writeSampleText( double sample, FILE *output );
+
+/*      writeSampleFloat()
+ *  Writes <sample> to <output> as a raw native-endian 32-bit float. */
+void writeSampleFloat( double sample, FILE *output );
+
+/*      writeSamplePcm16()
+ *  Writes <sample> to <output> as a raw native-endian 16-bit integer, clipped to full scale. */
+void writeSamplePcm16( double sample, FILE *output );
+
 /*  Other */
 
 /*      error()
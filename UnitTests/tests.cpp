@@ -3,6 +3,9 @@
 extern "C" {
 #include "test.h"
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 }
 
 TEST_GROUP(Samples) {};
@@ -10,6 +13,10 @@ TEST_GROUP(StringTesting) {};
 TEST_GROUP(DurationTests) {};
 TEST_GROUP(MidiTests) {};
 TEST_GROUP(HelperFunctions) {};
+TEST_GROUP(Pipeline) {};
+TEST_GROUP(CompiledScores) {};
+TEST_GROUP(Updates) {};
+TEST_GROUP(Server) {};
 
 TEST(Samples, initialSampleAccurate) {
    double result = calculateAngle(0, 1376.42, 0);
@@ -153,3 +160,372 @@ TEST(HelperFunctions, timeStampHandler_identifies_invalid_subsequent_runs) {
 	result = timestampToDurationHandler(notes, 1, -1);
 	CHECK(!result);
 }
+
+
+TEST(Pipeline, fadeGain_noFadeIsUnity) {
+	DOUBLES_EQUAL(1, fadeGain(0, 100, 0), 0.0000001);
+}
+
+TEST(Pipeline, fadeGain_fadesIn) {
+	DOUBLES_EQUAL(0, fadeGain(0, 100, 10), 0.0000001);
+	DOUBLES_EQUAL(0.5, fadeGain(5, 100, 10), 0.0000001);
+	DOUBLES_EQUAL(1, fadeGain(10, 100, 10), 0.0000001);
+}
+
+TEST(Pipeline, fadeGain_fadesOut) {
+	DOUBLES_EQUAL(0.5, fadeGain(94, 100, 10), 0.0000001);
+	DOUBLES_EQUAL(0, fadeGain(99, 100, 10), 0.0000001);
+}
+
+TEST(Pipeline, decibelsToGain_minusSix) {
+	DOUBLES_EQUAL(0.501187, decibelsToGain(-6), 0.000001);
+}
+
+TEST(Pipeline, noteSampleCount_oneSecond) {
+	struct Note note;
+	note.duration = 1000;
+	note.midiNote = 69;
+	CHECK_EQUAL(48000, noteSampleCount(note));
+}
+
+TEST(CompiledScores, compileNotes_countsNotesAndSamples) {
+	struct Note notes[3] = { { 1000, 69 }, { 500, 81 }, { 0, -1 } };
+	struct CompiledNote compiled[3];
+	struct Score score = compileNotes(notes, compiled);
+	CHECK_EQUAL(2, score.noteCount);
+	CHECK_EQUAL(48000, compiled[0].sampleCount);
+	CHECK_EQUAL(24000, compiled[1].sampleCount);
+	CHECK(72001 == score.totalSamples);
+	DOUBLES_EQUAL(880, compiled[1].frequency, 0.0000001);
+}
+
+TEST(CompiledScores, compileNotes_carriesPhaseBetweenNotes) {
+	struct Note notes[3] = { { 10, 60 }, { 10, 64 }, { 0, -1 } };
+	struct CompiledNote compiled[3];
+	compileNotes(notes, compiled);
+	DOUBLES_EQUAL(0, compiled[0].startPhase, 0.0000001);
+	DOUBLES_EQUAL(calculateAngle(480, midiToFrequency(60), 0), compiled[1].startPhase, 0.0000001);
+}
+
+TEST(CompiledScores, compileNotes_indexesStartSamples) {
+	struct Note notes[4] = { { 10, 60 }, { 20, 62 }, { 10, 64 }, { 0, -1 } };
+	struct CompiledNote compiled[4];
+	compileNotes(notes, compiled);
+	CHECK(0 == compiled[0].startSample);
+	CHECK(480 == compiled[1].startSample);
+	CHECK(1440 == compiled[2].startSample);
+}
+
+TEST(CompiledScores, findNoteAtSample_findsContainingNote) {
+	struct Note notes[4] = { { 10, 60 }, { 20, 62 }, { 10, 64 }, { 0, -1 } };
+	struct CompiledNote compiled[4];
+	struct Score score = compileNotes(notes, compiled);
+	CHECK_EQUAL(0, findNoteAtSample(&score, 0));
+	CHECK_EQUAL(0, findNoteAtSample(&score, 479));
+	CHECK_EQUAL(1, findNoteAtSample(&score, 480));
+	CHECK_EQUAL(2, findNoteAtSample(&score, 1440));
+}
+
+TEST(CompiledScores, findNoteAtSample_extraSampleBelongsToLastNote) {
+	struct Note notes[3] = { { 10, 60 }, { 10, 62 }, { 0, -1 } };
+	struct CompiledNote compiled[3];
+	struct Score score = compileNotes(notes, compiled);
+	CHECK_EQUAL(1, findNoteAtSample(&score, score.totalSamples - 1));
+}
+
+/* Prints samples <first> to <end> of <score> and compares them with the same samples of
+ * <fullRender>, which was printed by printScore() with <settings> */
+static bool rangeMatchesRender(const struct Score *score, unsigned long long first,
+                               unsigned long long end, struct RenderSettings settings,
+                               const char *fullRender) {
+	static char range[32768];
+	settings.output = tmpfile();
+	printRange(score, first, end, &settings);
+	fflush(settings.output);
+	rewind(settings.output);
+	size_t length = fread(range, 1, sizeof(range), settings.output);
+	fclose(settings.output);
+	return length == (end - first) * sizeof(float) &&
+	       memcmp(range, fullRender + first * sizeof(float), length) == 0;
+}
+
+TEST(CompiledScores, printRange_matchesSliceOfFullRender) {
+	struct Note notes[4] = { { 10, 60 }, { 20, 62 }, { 10, 64 }, { 0, -1 } };
+	struct CompiledNote compiled[4];
+	struct Score score = compileNotes(notes, compiled);
+	struct RenderSettings settings = { 0.5, 96, writeSampleFloat, tmpfile() };
+	printScore(&score, &settings);
+	fflush(settings.output);
+	rewind(settings.output);
+	static char fullRender[32768];
+	CHECK(score.totalSamples * sizeof(float) ==
+	      fread(fullRender, 1, sizeof(fullRender), settings.output));
+	fclose(settings.output);
+	CHECK(rangeMatchesRender(&score, 50, 700, settings, fullRender));   // Starts mid-note
+	CHECK(rangeMatchesRender(&score, 480, 1500, settings, fullRender)); // Starts at a note
+	CHECK(rangeMatchesRender(&score, 1900, 1921, settings, fullRender)); // Final extra sample
+	CHECK(rangeMatchesRender(&score, 1920, 1921, settings, fullRender));
+}
+
+TEST(Updates, sameNote_detectsPhaseShift) {
+	struct Note notes[3] = { { 10, 60 }, { 10, 62 }, { 0, -1 } };
+	struct Note edited[3] = { { 10, 61 }, { 10, 62 }, { 0, -1 } };
+	struct CompiledNote compiled[3], compiledEdit[3];
+	compileNotes(notes, compiled);
+	compileNotes(edited, compiledEdit);
+	CHECK(sameNote(&compiled[0], &compiled[0]));
+	CHECK(!sameNote(&compiled[0], &compiledEdit[0]));
+	CHECK(!sameNote(&compiled[1], &compiledEdit[1]));
+}
+
+TEST(Updates, reusableRange_wholeNoteWithoutFade) {
+	struct CompiledNote note = { 480, 60, 480, 261.63, 0 };
+	int first = -1, end = -1;
+	reusableRange(&note, 2000, 3000, 0, &first, &end);
+	CHECK_EQUAL(0, first);
+	CHECK_EQUAL(480, end);
+}
+
+TEST(Updates, reusableRange_skipsFades) {
+	struct CompiledNote note = { 0, 60, 1000, 261.63, 0 };
+	int first = -1, end = -1;
+	reusableRange(&note, 1001, 1201, 100, &first, &end);
+	CHECK_EQUAL(100, first);
+	CHECK_EQUAL(901, end);
+}
+
+TEST(Updates, reusableRange_noneInsideFade) {
+	struct CompiledNote note = { 950, 60, 50, 261.63, 0 };
+	int first = -1, end = -1;
+	reusableRange(&note, 1001, 1001, 100, &first, &end);
+	CHECK_EQUAL(0, first);
+	CHECK_EQUAL(0, end);
+}
+
+/* Reads the whole of <file> into <buffer> of <size> and returns its length */
+static size_t fileContents(FILE *file, char *buffer, size_t size) {
+	fflush(file);
+	rewind(file);
+	return fread(buffer, 1, size, file);
+}
+
+/* Renders <notes>, patches the output to <edited> as updateOutput() does and compares it with a
+ * full render of <edited>. Returns the number of samples patched. */
+static unsigned long long patchAgainstRender(const struct Note *notes, const struct Note *edited,
+                                             bool *matches) {
+	struct CompiledNote compiled[8], compiledEdit[8];
+	struct Score previous = compileNotes(notes, compiled);
+	struct Score score = compileNotes(edited, compiledEdit);
+	FILE *patched = tmpfile(), *rendered = tmpfile();
+	struct RenderSettings settings = { 0.5, 96, writeSampleFloat, patched };
+	printScore(&previous, &settings);
+	unsigned long long patchedSamples = patchOutput(patched, &score, &previous, &settings);
+	fflush(patched);
+	CHECK_EQUAL(0, ftruncate(fileno(patched), score.totalSamples * sizeof(float)));
+	settings.output = rendered;
+	printScore(&score, &settings);
+
+	static char expected[32768], actual[32768];
+	size_t expectedLength = fileContents(rendered, expected, sizeof(expected));
+	size_t actualLength = fileContents(patched, actual, sizeof(actual));
+	*matches = expectedLength == score.totalSamples * sizeof(float) &&
+	           actualLength == expectedLength && memcmp(expected, actual, expectedLength) == 0;
+	fclose(patched);
+	fclose(rendered);
+	return patchedSamples;
+}
+
+TEST(Updates, patchOutput_pitchEditMatchesRender) {
+	struct Note notes[5] = { { 10, 60 }, { 10, 62 }, { 10, 64 }, { 10, 65 }, { 0, -1 } };
+	struct Note edited[5] = { { 10, 60 }, { 10, 62 }, { 10, 64 }, { 10, 67 }, { 0, -1 } };
+	bool matches = false;
+	unsigned long long patchedSamples = patchAgainstRender(notes, edited, &matches);
+	CHECK(matches);
+	CHECK(patchedSamples < 1921); // The unchanged notes were reused
+}
+
+TEST(Updates, patchOutput_longerScoreMatchesRender) {
+	struct Note notes[4] = { { 10, 60 }, { 10, 62 }, { 10, 64 }, { 0, -1 } };
+	struct Note edited[5] = { { 10, 60 }, { 10, 62 }, { 10, 64 }, { 20, 65 }, { 0, -1 } };
+	bool matches = false;
+	patchAgainstRender(notes, edited, &matches);
+	CHECK(matches);
+}
+
+TEST(Updates, patchOutput_shorterScoreMatchesRender) {
+	struct Note notes[5] = { { 10, 60 }, { 10, 62 }, { 10, 64 }, { 10, 65 }, { 0, -1 } };
+	struct Note edited[3] = { { 10, 60 }, { 10, 62 }, { 0, -1 } };
+	bool matches = false;
+	patchAgainstRender(notes, edited, &matches);
+	CHECK(matches);
+}
+
+/* Lays out a compiled score of two notes in <buffer> as it would be in a file */
+static size_t compiledScoreBuffer(char *buffer) {
+	struct Note notes[3] = { { 10, 60 }, { 10, 62 }, { 0, -1 } };
+	struct CompiledNote compiled[3];
+	struct Score score = compileNotes(notes, compiled);
+	struct ScoreHeader header = { { 'M', 'O', 'S', 'C' }, g_scoreVersion, 2, 0, score.totalSamples };
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(buffer + sizeof(header), compiled, 2 * sizeof(struct CompiledNote));
+	return sizeof(header) + 2 * sizeof(struct CompiledNote);
+}
+
+TEST(CompiledScores, readScore_acceptsCompiledScore) {
+	double buffer[32];
+	size_t size = compiledScoreBuffer((char *) buffer);
+	struct Score score;
+	CHECK(readScore(buffer, size, &score));
+	CHECK_EQUAL(2, score.noteCount);
+	CHECK(961 == score.totalSamples);
+}
+
+TEST(CompiledScores, readScore_rejectsNegativeSampleCount) {
+	double buffer[32];
+	size_t size = compiledScoreBuffer((char *) buffer);
+	struct Score score;
+	((struct CompiledNote *) ((char *) buffer + sizeof(struct ScoreHeader)))[0].sampleCount = -1;
+	CHECK(!readScore(buffer, size, &score));
+}
+
+TEST(CompiledScores, readScore_rejectsWrongTotal) {
+	double buffer[32];
+	size_t size = compiledScoreBuffer((char *) buffer);
+	struct Score score;
+	((struct ScoreHeader *) buffer)->totalSamples = 5;
+	CHECK(!readScore(buffer, size, &score));
+}
+
+TEST(CompiledScores, readScore_rejectsGapBetweenNotes) {
+	double buffer[32];
+	size_t size = compiledScoreBuffer((char *) buffer);
+	struct Score score;
+	((struct CompiledNote *) ((char *) buffer + sizeof(struct ScoreHeader)))[1].startSample = 500;
+	CHECK(!readScore(buffer, size, &score));
+}
+
+TEST(Server, writeAll_readAll_roundTrip) {
+	int ends[2];
+	CHECK_EQUAL(0, pipe(ends));
+	CHECK(writeAll(ends[1], "0 60\n", 5));
+	close(ends[1]);
+	char buffer[16] = { 0 };
+	CHECK(5 == readAll(ends[0], buffer, sizeof(buffer)));
+	STRCMP_EQUAL("0 60\n", buffer);
+	close(ends[0]);
+}
+
+TEST(Server, copyStream_copiesUntilEnd) {
+	int from[2], to[2];
+	CHECK_EQUAL(0, pipe(from));
+	CHECK_EQUAL(0, pipe(to));
+	CHECK(writeAll(from[1], "0.000000\n0.180173\n", 18));
+	close(from[1]);
+	CHECK(18 == copyStream(from[0], to[1]));
+	close(to[1]);
+	char buffer[32] = { 0 };
+	CHECK(18 == readAll(to[0], buffer, sizeof(buffer)));
+	STRCMP_EQUAL("0.000000\n0.180173\n", buffer);
+	close(from[0]);
+	close(to[0]);
+}
+
+TEST(Server, readReplyStatus_acceptsSamples) {
+	int ends[2];
+	CHECK_EQUAL(0, pipe(ends));
+	CHECK(writeAll(ends[1], "OK 9\n0.000000\n", 14));
+	close(ends[1]);
+	char message[64];
+	long long length = 0;
+	CHECK(readReplyStatus(ends[0], &length, message, sizeof(message)));
+	CHECK(9 == length);
+	char buffer[16] = { 0 };
+	CHECK(9 == readAll(ends[0], buffer, sizeof(buffer)));
+	STRCMP_EQUAL("0.000000\n", buffer);
+	close(ends[0]);
+}
+
+TEST(Server, readReplyStatus_returnsErrorMessage) {
+	int ends[2];
+	CHECK_EQUAL(0, pipe(ends));
+	const char *reply = "User input not in a recognised format.\n";
+	CHECK(writeAll(ends[1], reply, strlen(reply)));
+	close(ends[1]);
+	char message[64];
+	long long length = 0;
+	CHECK(!readReplyStatus(ends[0], &length, message, sizeof(message)));
+	STRCMP_EQUAL("User input not in a recognised format.", message);
+	close(ends[0]);
+}
+
+TEST(Server, readReplyStatus_emptyReplyIsError) {
+	int ends[2];
+	CHECK_EQUAL(0, pipe(ends));
+	close(ends[1]);
+	char message[64];
+	long long length = 0;
+	CHECK(!readReplyStatus(ends[0], &length, message, sizeof(message)));
+	close(ends[0]);
+}
+
+TEST(Server, readReplyStatus_needsByteCount) {
+	int ends[2];
+	CHECK_EQUAL(0, pipe(ends));
+	CHECK(writeAll(ends[1], "OK \n0.000000\n", 13));
+	close(ends[1]);
+	char message[64];
+	long long length = 0;
+	CHECK(!readReplyStatus(ends[0], &length, message, sizeof(message)));
+	close(ends[0]);
+}
+
+TEST(Server, endsScore_findsNegativeNote) {
+	CHECK(endsScore("300 -1\n"));
+	CHECK(endsScore("300\t-1"));
+	CHECK(!endsScore("0 60\n"));
+	CHECK(!endsScore("\n"));
+}
+
+TEST(Server, commandLineArgHandler_readsServerOptions) {
+	const char *argv[] = { "MidiOsc", "-serve", "sock", "-workers", "3" };
+	struct ProgramOptions options = { { 1, 0, writeSampleText, stdout }, NULL, NULL, false, 0, 0,
+	                                  NULL, 4, NULL, NULL, 0, 0, NULL, NULL };
+	commandLineArgHandler(5, argv, &options);
+	STRCMP_EQUAL("sock", options.servePath);
+	CHECK_EQUAL(3, options.workerCount);
+}
+
+/* error() exits, so conflicting options are checked in a child process */
+static int commandLineExitCode(int argc, const char *argv[]) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		struct ProgramOptions options = { { 1, 0, writeSampleText, stdout }, NULL, NULL, false, 0,
+		                                  0, NULL, 4, NULL, NULL, 0, 0, NULL, NULL };
+		freopen("/dev/null", "w", stdout);
+		commandLineArgHandler(argc, argv, &options);
+		_exit(NO_ERR);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1; // A crash is not an exit code
+}
+
+TEST(Server, commandLineArgHandler_rejectsServeWithClient) {
+	const char *argv[] = { "MidiOsc", "-serve", "sock", "-client", "sock" };
+	CHECK_EQUAL(BAD_COMMAND_LINE, commandLineExitCode(5, argv));
+}
+
+TEST(Server, commandLineArgHandler_rejectsScoreWithServe) {
+	const char *argv[] = { "MidiOsc", "-score", "score.bin", "-serve", "sock" };
+	CHECK_EQUAL(BAD_COMMAND_LINE, commandLineExitCode(5, argv));
+}
+
+TEST(Server, commandLineArgHandler_rejectsRangeWithBench) {
+	const char *argv[] = { "MidiOsc", "-bench", "sock", "2", "10", "-range", "0", "10" };
+	CHECK_EQUAL(BAD_COMMAND_LINE, commandLineExitCode(8, argv));
+}
+
+TEST(Server, commandLineArgHandler_rejectsTooManyWorkers) {
+	const char *argv[] = { "MidiOsc", "-serve", "sock", "-workers", "65" };
+	CHECK_EQUAL(OUT_OF_BOUNDS_VALUE, commandLineExitCode(5, argv));
+}
\ No newline at end of file